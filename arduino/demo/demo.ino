@@ -1,6 +1,27 @@
 #define SYNC_BYTE 0xC7
+#define SYNC_BYTE_OVERSAMPLED 0xC8
 #define N_SENSORS 2
 
+/* Oversampling: OVERSAMPLE measurements per channel per frame, decimated to
+ * their mean (or median, with OVERSAMPLE_MEDIAN 1) and sent as fixed point
+ * with OVERSAMPLE_FRAC_BITS fractional bits. Frames then start with
+ * SYNC_BYTE_OVERSAMPLED and a format byte, (OVERSAMPLE-1) << 4 | FRAC_BITS.
+ * OVERSAMPLE 1 keeps the raw frame.
+ * Each fractional bit halves the largest value that fits in 16 bits, and
+ * readings above 65535 >> FRAC_BITS saturate. Averaging N samples only adds
+ * about log2(N)/2 bits of real precision, so 2 bits (up to 16383) cover
+ * OVERSAMPLE 16; more bits mostly trade range for noise. */
+#define OVERSAMPLE 1
+#define OVERSAMPLE_MEDIAN 0
+#define OVERSAMPLE_FRAC_BITS 2
+
+#if OVERSAMPLE < 1 || OVERSAMPLE > 16
+#error "OVERSAMPLE must be between 1 and 16 to fit the format byte"
+#endif
+#if OVERSAMPLE_FRAC_BITS < 0 || OVERSAMPLE_FRAC_BITS > 14
+#error "OVERSAMPLE_FRAC_BITS must be between 0 and 14"
+#endif
+
 typedef struct _ChCtx
 {
   byte analogPin;
@@ -12,6 +33,7 @@ typedef struct _ChCtx
 
 typedef struct _SensorData {
   size_t nData;
+  size_t nHeader;
   char* data;
 } SensorData;
 
@@ -29,16 +51,19 @@ double ohms;
 SensorData *SDCreate(size_t len, uint16_t sync)
 {
   SensorData* sd = (SensorData*)malloc(sizeof(SensorData));
-  sd->data = (char*)malloc(((len*2)+1)*sizeof(char));
+  sd->nHeader = (sync == SYNC_BYTE_OVERSAMPLED) ? 2 : 1;
+  sd->data = (char*)malloc(((len*2)+sd->nHeader)*sizeof(char));
   sd->nData = len;
-  sd->data[0] = SYNC_BYTE;
+  sd->data[0] = sync;
+  if (sync == SYNC_BYTE_OVERSAMPLED)
+    sd->data[1] = ((OVERSAMPLE - 1) << 4) | OVERSAMPLE_FRAC_BITS;
   return sd;
 }
 
 void SDAddDataToIndex(SensorData *sd, uint16_t data, size_t index)
 {
-  sd->data[index*2+1] = data >> 8;
-  sd->data[index*2+2] = data & 0xFF;
+  sd->data[index*2+sd->nHeader] = data >> 8;
+  sd->data[index*2+sd->nHeader+1] = data & 0xFF;
 }
 
 char *SDGetData(SensorData *sd)
@@ -48,7 +73,56 @@ char *SDGetData(SensorData *sd)
 
 size_t SDGetLength(SensorData *sd)
 {
-  return sd->nData*2 + 1;
+  return sd->nData*2 + sd->nHeader;
+}
+
+/* Measurement Functions */
+double measure(ChCtx *c)
+{
+  digitalWrite(c->chargePin, HIGH);
+  startTime = micros();
+  while(analogRead(c->analogPin) < 648) {}
+  elapsedTime = micros() - startTime;
+  digitalWrite(c->chargePin, LOW);
+  pinMode(c->dischargePin, OUTPUT);
+  digitalWrite(c->dischargePin, LOW);
+  while(analogRead(c->analogPin) > 0) {}
+  pinMode(c->dischargePin, INPUT);
+  return (double)elapsedTime / c->capValue;
+}
+
+double decimate(double *samples, int n)
+{
+  if (OVERSAMPLE_MEDIAN)
+  {
+    // Insertion sort, n is small
+    for (int i = 1; i < n; i++)
+    {
+      double s = samples[i];
+      int j = i - 1;
+      while (j >= 0 && samples[j] > s)
+      {
+        samples[j+1] = samples[j];
+        j--;
+      }
+      samples[j+1] = s;
+    }
+    if (n % 2)
+      return samples[n/2];
+    return (samples[n/2 - 1] + samples[n/2]) / 2;
+  }
+  double sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += samples[i];
+  return sum / n;
+}
+
+uint16_t toFixedPoint(double value)
+{
+  double scaled = value * (1UL << OVERSAMPLE_FRAC_BITS) + 0.5;
+  if (scaled > 0xFFFF)
+    return 0xFFFF;
+  return (uint16_t)scaled;
 }
 
 void setup(){
@@ -61,31 +135,22 @@ void setup(){
     pinMode(chargePins[i], OUTPUT);
     digitalWrite(chargePins[i], LOW);
   }
-  sd = SDCreate(2, SYNC_BYTE);
+  sd = SDCreate(2, (OVERSAMPLE > 1) ? SYNC_BYTE_OVERSAMPLED : SYNC_BYTE);
   Serial.begin(115200);
 }
 
 void loop(){
-  for (int i = 0; i < 2; i++)
+  double samples[OVERSAMPLE];
+  for (int i = 0; i < N_SENSORS; i++)
   {
-    digitalWrite(ch[i].chargePin, HIGH);
-    startTime = micros();
-    int reading;
-    while((reading = analogRead(ch[i].analogPin)) < 648) {}
-    elapsedTime = micros() - startTime;
-    ch[i].resValue = ((double)elapsedTime / (ch[i].capValue));
-    SDAddDataToIndex(sd, (uint16_t)ch[i].resValue, i);
-    digitalWrite(ch[i].chargePin, LOW);
-    pinMode(ch[i].dischargePin, OUTPUT);
-    digitalWrite(ch[i].dischargePin, LOW);
+    for (int n = 0; n < OVERSAMPLE; n++)
+      samples[n] = measure(&ch[i]);
+    ch[i].resValue = decimate(samples, OVERSAMPLE);
+    if (OVERSAMPLE > 1)
+      SDAddDataToIndex(sd, toFixedPoint(ch[i].resValue), i);
+    else
+      SDAddDataToIndex(sd, (uint16_t)ch[i].resValue, i);
   }
 
   Serial.write(SDGetData(sd), SDGetLength(sd));
-  for (int i = 0; i < 2; i++)
-  {
-    while(analogRead(ch[i].analogPin > 0)) {}
-    pinMode(ch[i].dischargePin, INPUT);
-  }
-
-
 }
@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
 
 #include <libserialport.h>
 #include <lo/lo.h>
@@ -12,10 +13,13 @@
 #include <glib.h>
 
 #define SYNC_BYTE 0xC7
+#define SYNC_BYTE_OVERSAMPLED 0xC8
+#define FORMAT_LOCK_FRAMES 8
 #define PROGRAM_NAME "Controller"
 #define MAX_CONFIG_SIZE 500000
-#define MAX_CALIB_SIZE 50000
-#define MAX_OUTPUTS 16
+#define MAX_CALIB_SIZE 500000
+#define MAX_OUTPUTS 4096
+#define BENCH_N_FRAMES 64
 
 typedef enum {
     OUT_MAP_LINEAR,
@@ -32,16 +36,25 @@ typedef enum {
     OUT_TYPE_INVALID
 } OutputType;
 
+typedef enum {
+    FRAME_OK,
+    FRAME_NO_SYNC,
+    FRAME_TIMEOUT
+} FrameStatus;
+
+#define N_GROUPS (OUT_MAP_INVALID*OUT_TYPE_INVALID)
+
 typedef struct _PArgs {
     gchar* cfg_file;
     gchar* calibration_file;
     gboolean calibrate;
+    gint benchmark;
 } PArgs;
 
 typedef struct _InCtx {
     gchar* label;
-    uint16_t min;
-    uint16_t max;
+    double min;
+    double max;
 } InCtx;
 
 typedef struct _OutCtx {
@@ -52,6 +65,27 @@ typedef struct _OutCtx {
     double* opts;
 } OutCtx;
 
+/* Outputs sharing mapping and type, laid out as structure of arrays so each
+ * processing stage runs as a straight loop over contiguous memory. */
+typedef struct _OutGroup {
+    OutputMapping map;
+    OutputType type;
+    size_t n;
+    size_t *out_idx;
+    size_t *in_idx;
+    double *in;
+    double *min;
+    double *max;
+    double *range;          // max-min, or log(max/min) for OUT_MAP_LOG
+    double *map_results;
+    double *last_map_results;
+    double *opt_a;          // continuous: opts[0], threshold: opts[0], differential: 1-opts[0]
+    double *opt_b;          // continuous: opts[1]-opts[0]
+    size_t *opts_size;      // discrete only
+    double **opts;          // discrete only
+    double *output;
+} OutGroup;
+
 typedef struct _PCtx {
     // Calibration related
     FILE* calibration_file;
@@ -62,6 +96,13 @@ typedef struct _PCtx {
 	int in_bd;
 	int in_n;
 	InCtx* in_ctx;
+	gboolean in_locked;
+	uint8_t in_sync;
+	uint8_t in_format;
+	uint8_t in_cand_sync;
+	uint8_t in_cand_format;
+	int in_cand_count;
+	double in_scale;
 
     // Output related
     gchar* out_osc_addr;
@@ -72,8 +113,7 @@ typedef struct _PCtx {
 	OutCtx* out_ctx;
 
     // Processing related
-    double *map_results;
-    double *last_map_results;
+    OutGroup groups[N_GROUPS];
     double *output;
 } PCtx;
     
@@ -185,7 +225,7 @@ void config_parse(PCtx* ctx, gchar* cfg_file)
     size_t cfg_size = fread(buf, sizeof(char), MAX_CONFIG_SIZE, cfg);
     if (ferror(cfg))
         LogAndDie("Erro: falha ao ler arquivo de configuracao");
-    buf[cfg_size + 1] = '\0';
+    buf[cfg_size] = '\0';
     fclose(cfg);
 
     // Parse JSON
@@ -251,6 +291,8 @@ void config_parse(PCtx* ctx, gchar* cfg_file)
     cJSON* n_outputs = cJSON_GetObjectItemCaseSensitive(output, "n_outputs");
     if (!cJSON_IsNumber(n_outputs))
         LogAndDie("Erro ao ler  output.n_outputs na configuracao");
+    if (n_outputs->valueint < 1 || n_outputs->valueint > MAX_OUTPUTS)
+        LogAndDie("Erro: output.n_outputs deve estar entre 1 e %d", MAX_OUTPUTS);
 
     cJSON* params = cJSON_GetObjectItemCaseSensitive(output, "params");
     if (!cJSON_IsArray(params))
@@ -264,10 +306,6 @@ void config_parse(PCtx* ctx, gchar* cfg_file)
     ctx->out_osc_channel = g_strdup(osc_channel->valuestring);
     ctx->out_n = n_outputs->valueint;
     ctx->out_ctx = malloc(ctx->out_n*sizeof(OutCtx));
-    ctx->map_results = malloc(ctx->out_n*sizeof(double));
-    memset(ctx->map_results, 0, ctx->out_n*sizeof(double));
-    ctx->last_map_results = malloc(ctx->out_n*sizeof(double));
-    memset(ctx->last_map_results, 0, ctx->out_n*sizeof(double));
     ctx->output = malloc(ctx->out_n*sizeof(double));
     memset(ctx->output, 0, ctx->out_n*sizeof(double));
     i = 0;
@@ -304,7 +342,6 @@ void config_parse(PCtx* ctx, gchar* cfg_file)
         if (!cJSON_IsArray(opts))
             LogAndDie("Erro ao ler output.params[%d].opts na configuracao", i);
         size_t opts_size = cJSON_GetArraySize(opts);
-        Log("opts size is %d, type is %d", opts_size, ctx->out_ctx[i].type);
         if (!output_type_check_n_opts(opts_size, ctx->out_ctx[i].type))
             LogAndDie("Erro: quantidade de opts incorreta para output.params[%d].type escolhido", i);
         ctx->out_ctx[i].opts_size = opts_size;
@@ -336,7 +373,7 @@ void calib_parse(PCtx *ctx, gchar *calib_file)
     size_t calib_size = fread(buf, sizeof(char), MAX_CALIB_SIZE, calib);
     if (ferror(calib))
         LogAndDie("Erro: falha ao ler arquivo de calibragem");
-    buf[calib_size + 1] = '\0';
+    buf[calib_size] = '\0';
     fclose(calib);
 
     // Parse JSON
@@ -357,123 +394,384 @@ void calib_parse(PCtx *ctx, gchar *calib_file)
     {
         cJSON* min = cJSON_GetObjectItemCaseSensitive(pair, "min");
         if (!cJSON_IsNumber(min) || 
-            min->valueint < 0)
+            min->valuedouble < 0)
             LogAndDie("Erro ao ler data[%d].min na calibragem.", i);
         cJSON* max = cJSON_GetObjectItemCaseSensitive(pair, "max");
-        if (!cJSON_IsNumber(min) || 
-            max->valueint < 0 ||
-            max->valueint < min->valueint)
+        if (!cJSON_IsNumber(max) || 
+            max->valuedouble < 0 ||
+            max->valuedouble < min->valuedouble)
             LogAndDie("Erro ao ler data[%d].max na calibragem.", i);
-        ctx->in_ctx[i].min = min->valueint;
-        ctx->in_ctx[i].max = max->valueint;
+        ctx->in_ctx[i].min = min->valuedouble;
+        ctx->in_ctx[i].max = max->valuedouble;
         i++;
     }
     cJSON_Delete(calib_json);
 }
 
-/* Main and Calibrate Loop, processing functions */
-double process_map(uint16_t input, uint16_t min, uint16_t max, OutputMapping map)
+/* Serial frames */
+uint16_t frame_get_input(const uint8_t *frame, size_t in)
+{
+    return (frame[in*2+1] << 8) + frame[in*2+2];
+}
+
+/* Oversampled frames carry a format byte after the sync byte: high nibble is
+ * the oversampling factor minus one, low nibble the number of fractional bits
+ * of each value. Values are scaled back to calibration units on input. */
+void frame_set_format(PCtx *ctx, uint8_t sync, uint8_t format)
+{
+    int oversample = (format >> 4) + 1;
+    int frac_bits = format & 0x0F;
+    if (sync == SYNC_BYTE_OVERSAMPLED)
+        Log("Entrada com sobreamostragem %dx, %d bits fracionarios", oversample, frac_bits);
+    else
+        Log("Entrada sem sobreamostragem");
+    ctx->in_scale = 1.0/(double)(1 << frac_bits);
+}
+
+/* Reads one frame into buf as [sync][data], the format byte is not kept.
+ * Sync and format are locked after FORMAT_LOCK_FRAMES consecutive frames
+ * agree on them, so a data byte equal to a sync byte cannot change the
+ * scale. Frames in another format are dropped until FORMAT_LOCK_FRAMES of
+ * them in a row agree, then the lock moves to the new format. */
+FrameStatus frame_read(PCtx *ctx, uint8_t *buf, unsigned int timeout)
+{
+    size_t data_size = 2*(ctx->in_n);
+    uint8_t format = 0;
+    int result;
+
+    result = check(sp_blocking_read(ctx->in_port, buf, 1, timeout));
+    if (result != 1)
+        return FRAME_TIMEOUT;
+    if (buf[0] == SYNC_BYTE_OVERSAMPLED)
+    {
+        result = check(sp_blocking_read(ctx->in_port, &format, 1, timeout));
+        if (result != 1)
+            return FRAME_TIMEOUT;
+        if ((format & 0x0F) > 14)
+            return FRAME_NO_SYNC;
+    }
+    else if (buf[0] != SYNC_BYTE)
+        return FRAME_NO_SYNC;
+
+    result = check(sp_blocking_read(ctx->in_port, buf + 1, data_size, timeout));
+    if (result != data_size)
+        return FRAME_TIMEOUT;
+
+    if (ctx->in_locked &&
+        buf[0] == ctx->in_sync &&
+        format == ctx->in_format)
+    {
+        ctx->in_cand_count = 0;
+        return FRAME_OK;
+    }
+
+    // Not the locked format: count consecutive frames of this candidate
+    if (ctx->in_cand_count > 0 &&
+        buf[0] == ctx->in_cand_sync &&
+        format == ctx->in_cand_format)
+        ctx->in_cand_count++;
+    else
+    {
+        ctx->in_cand_sync = buf[0];
+        ctx->in_cand_format = format;
+        ctx->in_cand_count = 1;
+    }
+    if (ctx->in_cand_count < FORMAT_LOCK_FRAMES)
+        return FRAME_NO_SYNC;
+
+    if (ctx->in_locked)
+        Log("Aviso: formato da entrada mudou");
+    ctx->in_locked = TRUE;
+    ctx->in_sync = ctx->in_cand_sync;
+    ctx->in_format = ctx->in_cand_format;
+    ctx->in_cand_count = 0;
+    frame_set_format(ctx, ctx->in_sync, ctx->in_format);
+    return FRAME_OK;
+}
+
+/* Processing layout */
+void process_layout_build(PCtx *ctx)
+{
+    // Count outputs per mapping/type group
+    size_t counts[N_GROUPS] = {0};
+    for (int out = 0; out < ctx->out_n; out++)
+        counts[ctx->out_ctx[out].map*OUT_TYPE_INVALID + ctx->out_ctx[out].type]++;
+
+    for (int g = 0; g < N_GROUPS; g++)
+    {
+        OutGroup *grp = &ctx->groups[g];
+        size_t n = counts[g];
+        grp->map = g / OUT_TYPE_INVALID;
+        grp->type = g % OUT_TYPE_INVALID;
+        grp->n = 0;
+        grp->out_idx = malloc(n*sizeof(size_t));
+        grp->in_idx = malloc(n*sizeof(size_t));
+        grp->in = malloc(n*sizeof(double));
+        grp->min = malloc(n*sizeof(double));
+        grp->max = malloc(n*sizeof(double));
+        grp->range = malloc(n*sizeof(double));
+        grp->map_results = malloc(n*sizeof(double));
+        memset(grp->map_results, 0, n*sizeof(double));
+        grp->last_map_results = malloc(n*sizeof(double));
+        memset(grp->last_map_results, 0, n*sizeof(double));
+        grp->opt_a = malloc(n*sizeof(double));
+        grp->opt_b = malloc(n*sizeof(double));
+        grp->opts_size = malloc(n*sizeof(size_t));
+        grp->opts = malloc(n*sizeof(double*));
+        grp->output = malloc(n*sizeof(double));
+    }
+
+    // Fill groups, keeping config order inside each group
+    for (int out = 0; out < ctx->out_n; out++)
+    {
+        OutCtx *oc = &ctx->out_ctx[out];
+        InCtx *ic = &ctx->in_ctx[oc->from_input];
+        OutGroup *grp = &ctx->groups[oc->map*OUT_TYPE_INVALID + oc->type];
+        size_t k = grp->n++;
+        double min_d = ic->min;
+        double max_d = ic->max;
+
+        grp->out_idx[k] = out;
+        grp->in_idx[k] = oc->from_input;
+        grp->min[k] = min_d;
+        grp->max[k] = max_d;
+        if (max_d <= min_d)
+            grp->range[k] = 1;
+        else if (oc->map == OUT_MAP_LOG)
+            grp->range[k] = log(max_d/min_d);
+        else
+            grp->range[k] = max_d - min_d;
+        grp->opt_a[k] = 0;
+        grp->opt_b[k] = 0;
+        grp->opts_size[k] = oc->opts_size;
+        grp->opts[k] = oc->opts;
+        switch (oc->type)
+        {
+            case OUT_TYPE_CONTINUOUS:
+                grp->opt_a[k] = oc->opts[0];
+                grp->opt_b[k] = oc->opts[1] - oc->opts[0];
+                break;
+            case OUT_TYPE_THRESHOLD:
+                grp->opt_a[k] = oc->opts[0];
+                break;
+            case OUT_TYPE_DIFFERENTIAL:
+                grp->opt_a[k] = 1 - oc->opts[0];
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* Processing kernels, each over a whole group. The linear map and
+ * the continuous, threshold and differential outputs are branch free loops
+ * the compiler emits SIMD code for. Exp/log maps call libm per element and
+ * discrete outputs index a table, so those stay scalar. */
+void kernel_gather(OutGroup *grp, const uint8_t *frame, double scale)
+{
+    for (size_t k = 0; k < grp->n; k++)
+        grp->in[k] = frame_get_input(frame, grp->in_idx[k])*scale;
+}
+
+void kernel_map(OutGroup *grp)
 {
     static const double euler_constant = exp(1);
-    if (input < min)
-        return 0;
-    if (input > max) 
-        return 1;
-    double in_d = (double)input;
-    double min_d = (double)min;
-    double max_d = (double)max;
-    switch (map)
+    const double *restrict in = grp->in;
+    const double *restrict min = grp->min;
+    const double *restrict max = grp->max;
+    const double *restrict range = grp->range;
+    double *restrict res = grp->map_results;
+    double *restrict last = grp->last_map_results;
+
+    switch (grp->map)
     {
         case OUT_MAP_LINEAR:
-            return (in_d-min_d)/(max_d-min_d);
+            #pragma omp simd
+            for (size_t k = 0; k < grp->n; k++)
+            {
+                double x = in[k] < min[k] ? min[k] : in[k];
+                x = x > max[k] ? max[k] : x;
+                last[k] = res[k];
+                res[k] = (x-min[k])/range[k];
+            }
+            break;
         case OUT_MAP_EXP:
-            return (exp((in_d-min_d)/(max_d-min_d))-1)/(euler_constant-1);
+            for (size_t k = 0; k < grp->n; k++)
+            {
+                double x = in[k] < min[k] ? min[k] : in[k];
+                x = x > max[k] ? max[k] : x;
+                last[k] = res[k];
+                res[k] = (exp((x-min[k])/range[k])-1)/(euler_constant-1);
+            }
+            break;
         case OUT_MAP_LOG:
-            return log(in_d/min_d)/log(max_d/min_d);
+            for (size_t k = 0; k < grp->n; k++)
+            {
+                double x = in[k] < min[k] ? min[k] : in[k];
+                x = x > max[k] ? max[k] : x;
+                last[k] = res[k];
+                res[k] = log(x/min[k])/range[k];
+            }
+            break;
         default:
             break;
     }
-    return 0;
 }
 
-double process_out(double input, OutputType type, size_t opts_size, double *opts, double last_input)
+void kernel_out(OutGroup *grp)
 {
-    switch (type)
+    const double *restrict res = grp->map_results;
+    const double *restrict last = grp->last_map_results;
+    const double *restrict a = grp->opt_a;
+    const double *restrict b = grp->opt_b;
+    double *restrict out = grp->output;
+
+    switch (grp->type)
     {
         case OUT_TYPE_CONTINUOUS:
-            return (input*(opts[1] - opts[0])) + opts[0];
+            #pragma omp simd
+            for (size_t k = 0; k < grp->n; k++)
+                out[k] = (res[k]*b[k]) + a[k];
+            break;
         case OUT_TYPE_DISCRETE:
-            return opts[(size_t)(floor(input*(double)(opts_size)))];
+            for (size_t k = 0; k < grp->n; k++)
+            {
+                size_t idx = (size_t)(floor(res[k]*(double)(grp->opts_size[k])));
+                if (idx >= grp->opts_size[k])
+                    idx = grp->opts_size[k] - 1;
+                out[k] = grp->opts[k][idx];
+            }
+            break;
         case OUT_TYPE_THRESHOLD:
-            if (input >= opts[0])
-                return 1;
-            else 
-                return 0;
+            #pragma omp simd
+            for (size_t k = 0; k < grp->n; k++)
+                out[k] = res[k] >= a[k] ? 1 : 0;
+            break;
         case OUT_TYPE_DIFFERENTIAL:
-            if (fabs(last_input-input) > (1-opts[0]))
-                return 1;
-            else
-                return 0;
+            #pragma omp simd
+            for (size_t k = 0; k < grp->n; k++)
+                out[k] = fabs(last[k]-res[k]) > a[k] ? 1 : 0;
+            break;
         default:
             break;
     }
-    return 0;
 }
 
-void process_and_send(PCtx *ctx, char *buf, size_t buf_size)
+void kernel_scatter(OutGroup *grp, double *output)
 {
-    // Process input
-    for (int out = 0; out < ctx->out_n; out++)
+    for (size_t k = 0; k < grp->n; k++)
+        output[grp->out_idx[k]] = grp->output[k];
+}
+
+void process_frame(PCtx *ctx, const uint8_t *frame)
+{
+    for (int g = 0; g < N_GROUPS; g++)
     {
-        // Save last results for differential output
-        ctx->last_map_results[out] = ctx->map_results[out];
-
-        size_t in = ctx->out_ctx[out].from_input;
-        uint16_t input = (buf[in*2+1] << 8) + buf[in*2+2];
-        ctx->map_results[out] = process_map(input,
-                                            ctx->in_ctx[in].min,
-                                            ctx->in_ctx[in].max,
-                                            ctx->out_ctx[out].map);
-
-        ctx->output[out] = process_out(ctx->map_results[out],
-                                       ctx->out_ctx[out].type,
-                                       ctx->out_ctx[out].opts_size,
-                                       ctx->out_ctx[out].opts,
-                                       ctx->last_map_results[out]);
+        OutGroup *grp = &ctx->groups[g];
+        if (grp->n == 0)
+            continue;
+        kernel_gather(grp, frame, ctx->in_scale);
+        kernel_map(grp);
+        kernel_out(grp);
+        kernel_scatter(grp, ctx->output);
     }
-    lo_send(ctx->out_osc,
-            ctx->out_osc_channel,
-            "ffffffff",
-            (float) ctx->output[0],
-            (float) ctx->output[1],
-            (float) ctx->output[2],
-            (float) ctx->output[3],
-            (float) ctx->output[4],
-            (float) ctx->output[5],
-            (float) ctx->output[6],
-            (float) ctx->output[7]);
+}
+
+lo_message output_message_new(PCtx *ctx)
+{
+    lo_message msg = lo_message_new();
+    for (int out = 0; out < ctx->out_n; out++)
+        lo_message_add_float(msg, (float) ctx->output[out]);
+    return msg;
+}
+
+/* Main, Benchmark and Calibrate Loop */
+void process_and_send(PCtx *ctx, uint8_t *buf)
+{
+    process_frame(ctx, buf);
+
+    lo_message msg = output_message_new(ctx);
+    lo_send_message(ctx->out_osc, ctx->out_osc_channel, msg);
+    lo_message_free(msg);
 }
 
 int main_loop(PCtx *ctx)
 {
-    size_t readSize = 2*(ctx->in_n) + 1;
-    char *buf = malloc(readSize*sizeof(char));
+    uint8_t *buf = malloc((2*(ctx->in_n) + 1)*sizeof(uint8_t));
     unsigned int timeout = 1000;
-    int result;
+    FrameStatus status = FRAME_OK;
+    FrameStatus last_status;
 
     while (1)
     {
-		result = check(sp_blocking_read(ctx->in_port, buf, readSize, timeout));
-        if (result == readSize)
+        last_status = status;
+		status = frame_read(ctx, buf, timeout);
+        if (status == FRAME_OK)
+            process_and_send(ctx, buf);
+        else if (status == FRAME_NO_SYNC && last_status != FRAME_NO_SYNC &&
+                 ctx->in_locked)
+            Log("Aviso: perda de sincronia.");
+		else if (status == FRAME_TIMEOUT)
+			Log("Timed out, incomplete frame.");
+	}
+}
+
+double benchmark_elapsed(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec)/1e9;
+}
+
+int benchmark_loop(PCtx *ctx, int n_frames)
+{
+    // Synthetic frames over each input's calibrated range plus a quarter of
+    // it on each side, so clamping paths are exercised too
+    size_t frame_size = 2*(ctx->in_n) + 1;
+    uint8_t *frames = malloc(BENCH_N_FRAMES*frame_size*sizeof(uint8_t));
+    srand(0);
+    for (int f = 0; f < BENCH_N_FRAMES; f++)
+    {
+        uint8_t *frame = frames + f*frame_size;
+        frame[0] = SYNC_BYTE;
+        for (int in = 0; in < ctx->in_n; in++)
         {
-            if ((uint8_t)buf[0] != SYNC_BYTE)
-                Log("Aviso: perda de sincronia.");
-            else
-                process_and_send(ctx, buf, readSize);
+            int min = (int)ctx->in_ctx[in].min;
+            int max = (int)ctx->in_ctx[in].max;
+            int margin = (max - min)/4 + 1;
+            int value = min - margin + rand() % (max - min + 2*margin + 1);
+            value = CLAMP(value, 0, 0xFFFF);
+            frame[in*2+1] = value >> 8;
+            frame[in*2+2] = value & 0xFF;
         }
-		else
-			Log("Timed out, %d/%d bytes received.\n", result, readSize);
-	}
+    }
+
+    // Processing and OSC message construction are timed separately; sending
+    // is left out since it depends on the network
+    struct timespec start, end;
+    Log("Benchmark: %d saidas, %d quadros", ctx->out_n, n_frames);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int f = 0; f < n_frames; f++)
+        process_frame(ctx, frames + (f % BENCH_N_FRAMES)*frame_size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double process_time = benchmark_elapsed(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int f = 0; f < n_frames; f++)
+    {
+        lo_message msg = output_message_new(ctx);
+        lo_message_free(msg);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double message_time = benchmark_elapsed(&start, &end);
+
+    double outputs = (double)n_frames*ctx->out_n;
+    Log("Processamento: %8.2f us/quadro, %8.2f Msaidas/s",
+        process_time/n_frames*1e6, outputs/process_time/1e6);
+    Log("Mensagem OSC:  %8.2f us/quadro, %8.2f Msaidas/s",
+        message_time/n_frames*1e6, outputs/message_time/1e6);
+    Log("Total:         %8.2f us/quadro",
+        (process_time + message_time)/n_frames*1e6);
+    free(frames);
+    return 0;
 }
 
 void calibration_save_to_file(PCtx *ctx)
@@ -496,9 +794,9 @@ void calibration_save_to_file(PCtx *ctx)
 
 }
 
-gboolean calibration_get_mean(uint16_t *samples, uint16_t *result)
+gboolean calibration_get_mean(uint16_t *samples, double scale, double *result)
 {
-    uint64_t mean = 0;
+    uint64_t sum = 0;
     uint32_t max = 0;
     uint32_t min = 0xFFFFFFFF;
     for (int i = 0; i < 256; i++)
@@ -507,31 +805,32 @@ gboolean calibration_get_mean(uint16_t *samples, uint16_t *result)
             min = samples[i];
         if (samples[i] > max)
             max = samples[i];
-        mean += samples[i];
+        sum += samples[i];
     }
-    mean = mean/256;
+    double mean = (double)sum/256;
 
-    Log("mean %d max %d min %d", mean, max, min);
-    if ((double)mean * 1.10 < max ||
-        (double)mean * 0.90 > min)
+    Log("mean %.2f max %.2f min %.2f", mean*scale, max*scale, min*scale);
+    if (mean * 1.10 < max ||
+        mean * 0.90 > min)
         return FALSE;
 
-    *result = (uint16_t) mean;
+    *result = floor(mean)*scale;
     return TRUE;
 }
 
 int calibration_loop(PCtx *ctx)
 {
     size_t readSize = 2*(ctx->in_n) + 1;
-    char *buf = malloc(readSize*sizeof(char));
+    uint8_t *buf = malloc(readSize*sizeof(uint8_t));
     unsigned int timeout = 1000;
-    int result;
+    FrameStatus status;
     uint16_t samples[256];
 
     // For each sensor
     Log("Calibragem iniciando");
     int i = 0, j = 0, k = 0;
     int error_count;
+    size_t skipped;
     while(i < ctx->in_n)
     {
         //log("Calibrando Sensor %s [%d]", ctx->in_ctx[i]->label, i);
@@ -548,29 +847,29 @@ int calibration_loop(PCtx *ctx)
             Log("Tirando medidas!");
             k = 0;
             error_count = 0;
+            skipped = 0;
             while (k < 256)
             {
-                result = check(sp_blocking_read(ctx->in_port, buf, readSize, timeout));
-                if (result == readSize)
+                status = frame_read(ctx, buf, timeout);
+                if (status == FRAME_OK)
                 {
-                    if ((uint8_t)buf[0] != SYNC_BYTE)
-                        error_count++;
-                    else
-                    {
-                        uint16_t input = (buf[i*2+1] << 8) + buf[i*2+2];
-                        samples[k] = input;
-                        k++;
-                    }
+                    samples[k] = frame_get_input(buf, i);
+                    k++;
+                    skipped = 0;
                 }
-                else
+                // Bytes skipped while looking for sync only count once per frame size
+                else if (status == FRAME_TIMEOUT || ++skipped > readSize)
+                {
                     error_count++;
+                    skipped = 0;
+                }
                 if (k%100 == 0 && k != 0)
                     Log("%d/256 medidas tiradas", k);
                 if (error_count > 10)
                     LogAndDie("Erro: falha na comunicacao serial. Verifique a conexao");
             }
-            uint16_t result;
-            gboolean valid = calibration_get_mean(samples, &result);
+            double result;
+            gboolean valid = calibration_get_mean(samples, ctx->in_scale, &result);
             if (!valid)
                 Log("Resultado inconsistente. Recomecando tentativa");
             else
@@ -599,6 +898,7 @@ int main(int argc, char** argv)
     args->cfg_file = NULL;
     args->calibration_file = NULL;
     args->calibrate = FALSE;
+    args->benchmark = 0;
     GOptionContext* opt_ctx = NULL;
     GOptionGroup* opt_grp = NULL;
     GError* g_err = NULL;
@@ -610,6 +910,8 @@ int main(int argc, char** argv)
 			"Arquivo de calibragem. Executando no modo de calibragem, resultados serao escritos neste arquivo. Caso contrario, sera lido.", "CALIBRA_ARQUIVO"},
 		{"calibra", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &(args->calibrate),
 			"Executar no modo de calibragem", NULL},
+		{"benchmark", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &(args->benchmark),
+			"Executar no modo benchmark, processando N quadros sinteticos", "N"},
 		{NULL}
 	};
     opt_ctx = g_option_context_new("Controlador Serial para OSC");
@@ -631,9 +933,14 @@ int main(int argc, char** argv)
         Log("%s", ctx_help);
         exit(1);
     }
+    if (args->benchmark < 0 || (args->benchmark > 0 && args->calibrate))
+        LogAndDie("Erro: modo benchmark requer numero de quadros positivo e nao pode ser usado com calibragem");
 
     // Create new program context, populate it with config file info 
     PCtx* ctx = malloc(sizeof(PCtx));
+    ctx->in_locked = FALSE;
+    ctx->in_cand_count = 0;
+    ctx->in_scale = 1;
     Log("Lendo arquivo de configuracao...");
     config_parse(ctx, args->cfg_file);
     Log("Sucesso!");
@@ -653,8 +960,13 @@ int main(int argc, char** argv)
         Log("Lendo arquivo de calibragem...");
         calib_parse(ctx, args->calibration_file);
         Log("Sucesso!");
+        process_layout_build(ctx);
     }
 
+    // Benchmark mode does not touch serial port nor OSC
+    if (args->benchmark > 0)
+        return benchmark_loop(ctx, args->benchmark);
+
     // Open and configure serial port
     Log("Procurando porta serial %s.", ctx->in_device);
     check(sp_get_port_by_name(ctx->in_device, &(ctx->in_port)));